@@ -0,0 +1,31 @@
+#!/bin/bash
+# Page backing, dTLB load misses, page faults and runtime of rainfall_pt
+# with and without --arena (grids in one huge page backed mapping) on the
+# sample inputs. dTLB misses need perf events, see
+# /proc/sys/kernel/perf_event_paranoid, they read n/a otherwise.
+# usage: ./arena_report.sh [P]
+P=${1:-1}
+# M A N file
+RUNS=("20 0.5 32 sample_32x32"
+      "30 0.25 128 sample_128x128"
+      "30 0.75 512 sample_512x512")
+
+cd rainfall
+make -s rainfall_pt || exit 1
+
+printf "%-22s %-7s %-24s %14s %8s %10s\n" input arena pages dtlb_misses faults rt_s
+for run in "${RUNS[@]}"; do
+    set -- $run
+    [ -f ../$4.in ] || continue
+    for opt in "" --arena; do
+        ./rainfall_pt $P $1 $2 $3 ../$4.in $opt --tlb-report 2> out-arena > /dev/null || continue
+        awk -v input=$4 -v arena=${opt:+yes} '
+            /Runtime/ { rt = $3 }
+            /^Arena:/ { sub(/^Arena: /, ""); pages = $0 }
+            /dTLB/ { misses = $NF }
+            /Page faults/ { faults = $NF }
+            END { printf "%-22s %-7s %-24s %14s %8s %10s\n", input, arena ? arena : "no",
+                  pages, misses, faults, rt }' out-arena
+    done
+done
+rm -f out-arena
@@ -0,0 +1,32 @@
+#!/bin/bash
+# Runtime of every execution backend (--backend) for P = 1, 2, 4, ... up
+# to the number of CPUs on the sample inputs, checked against the
+# result of the default spawn backend.
+# usage: ./backend_report.sh [max_P]
+MAX_P=${1:-$(nproc)}
+# M A N file
+RUNS=("20 0.5 32 sample_32x32"
+      "30 0.25 128 sample_128x128"
+      "30 0.75 512 sample_512x512")
+
+cd rainfall
+make -s rainfall_pt || exit 1
+BACKENDS=$(./rainfall_pt | sed -n 's/.*--backend=<name> = [^:]*: \(.*\) (default.*/\1/p' | tr -d ,)
+
+printf "%-16s %-8s %4s %8s %10s %s\n" input backend P steps rt_s result
+for run in "${RUNS[@]}"; do
+    set -- $run
+    [ -f ../$4.in ] || continue
+    for ((P = 1; P <= MAX_P; P *= 2)); do
+        ./rainfall_pt $P $1 $2 $3 ../$4.in 2> out-spawn > /dev/null
+        for backend in $BACKENDS; do
+            ./rainfall_pt $P $1 $2 $3 ../$4.in --backend=$backend 2> out-backend > /dev/null || continue
+            steps=$(awk '/took/ { print $4 }' out-backend)
+            rt=$(awk '/Runtime/ { print $3 }' out-backend)
+            same=differs
+            cmp -s <(grep -v Runtime out-spawn) <(grep -v Runtime out-backend) && same=same
+            printf "%-16s %-8s %4d %8s %10s %s\n" $4 $backend $P $steps $rt $same
+        done
+    done
+done
+rm -f out-spawn out-backend
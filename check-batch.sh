@@ -0,0 +1,20 @@
+#!/bin/bash
+# runs the samples as one rainfall_batch pipeline, every job has to give
+# the reference output, a malformed job is reported and skipped
+cd rainfall
+cat > batch-jobs <<JOBS
+# P M A N elevation_file output_file [options]
+1 10 0.25 4 ../sample_4x4.in batch-out-4
+1 ten 0.25 4 ../sample_4x4.in batch-out-bad
+2 20 0.5 16 ../sample_16x16.in batch-out-16 --steal
+2 20 0.5 32 ../sample_32x32.in batch-out-32 --backend=pool
+4 30 0.25 128 ../sample_128x128.in batch-out-128 --tiles
+2 30 0.75 512 ../sample_512x512.in batch-out-512
+JOBS
+./rainfall_batch batch-jobs 1 >batch-log && echo "malformed job not counted as failed"
+grep -q "job 2: P, M, A and N must be numbers" batch-log || echo "malformed job not reported"
+for N in 4 16 32 128 512; do
+    echo -n "sample_${N}x${N}: "
+    ../check.py $N ../sample_${N}x${N}.out batch-out-$N
+done
+rm -f batch-jobs batch-log batch-out-*
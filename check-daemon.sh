@@ -0,0 +1,23 @@
+#!/bin/bash
+# runs the samples through rainfalld twice, the second round comes
+# from the landscape cache
+SOCK=/tmp/rainfalld-check.$$
+cd rainfall
+./rainfalld 2 4 $SOCK 2>daemon-out &
+DAEMON=$!
+while [ ! -S $SOCK ]; do sleep 0.1; done
+for round in 1 2; do
+    ./rainfall_client 1 10 0.25 4 ../sample_4x4.in $SOCK 2>client-out-1
+    ../check.py 4 ../sample_4x4.out client-out-1
+    ./rainfall_client 2 20 0.5 16 ../sample_16x16.in $SOCK 2>client-out-2
+    ../check.py 16 ../sample_16x16.out client-out-2
+    ./rainfall_client 2 30 0.25 128 ../sample_128x128.in $SOCK 2>client-out-4
+    ../check.py 128 ../sample_128x128.out client-out-4
+done
+# a bad N is refused without taking the daemon down
+./rainfall_client 1 10 0.25 200000 ../sample_4x4.in $SOCK 2>/dev/null
+./rainfall_client 1 10 0.25 4 ../sample_4x4.in $SOCK 2>client-out-1
+../check.py 4 ../sample_4x4.out client-out-1
+kill $DAEMON
+wait $DAEMON
+tail -1 daemon-out
@@ -0,0 +1,19 @@
+#!/bin/bash
+# runs the samples with --epsilon=A, water at or below A is absorbed in
+# place on the next step anyway, so the grid has to match the reference
+# and at most one step is saved
+cd rainfall
+# P M A N sample
+RUNS=("1 10 0.25 4 sample_4x4"
+      "2 20 0.5 16 sample_16x16"
+      "2 20 0.5 32 sample_32x32"
+      "4 30 0.25 128 sample_128x128"
+      "2 30 0.75 512 sample_512x512")
+for run in "${RUNS[@]}"; do
+    set -- $run
+    ./rainfall_pt $1 $2 $3 $4 ../$5.in --epsilon=$3 --epsilon-report 2>epsilon-out >/dev/null
+    echo -n "$5: "
+    ../check.py $4 ../$5.out epsilon-out
+    grep "Epsilon saved" epsilon-out | awk '$3 > 1 { print "  saved " $3 " steps" }'
+done
+rm -f epsilon-out
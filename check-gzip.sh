@@ -0,0 +1,17 @@
+#!/bin/bash
+# runs gzip compressed copies of the samples, which have to give the
+# reference outputs
+cd rainfall
+# P M A N sample
+RUNS=("1 10 0.25 4 sample_4x4"
+      "2 20 0.5 16 sample_16x16"
+      "4 30 0.25 128 sample_128x128"
+      "2 30 0.75 512 sample_512x512")
+for run in "${RUNS[@]}"; do
+    set -- $run
+    gzip -c ../$5.in > gzip-in
+    ./rainfall_pt $1 $2 $3 $4 gzip-in 2>gzip-out >/dev/null
+    echo -n "$5.gz: "
+    ../check.py $4 ../$5.out gzip-out
+done
+rm -f gzip-in gzip-out
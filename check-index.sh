@@ -0,0 +1,51 @@
+#!/bin/bash
+# writes an index of the 128x128 sample and checks rectangle queries
+# against totals and maxima read off the printed grid
+cd rainfall
+./rainfall_pt 2 30 0.25 128 ../sample_128x128.in --index=index-out 2>pt-out-index
+# r0 c0 r1 c1
+RECTS=("0 0 127 127" "5 9 5 9" "10 20 73 31" "64 0 127 63" "1 2 3 120")
+for rect in "${RECTS[@]}"; do
+    set -- $rect
+    want=$(awk -v r0=$1 -v c0=$2 -v r1=$3 -v c1=$4 '
+        /^The following/ { row = 0; next }
+        row == "" { next }
+        { if (row >= r0 && row <= r1) for (j = c0; j <= c1; j++) { s += $(j + 1); if (m == "" || $(j + 1) > m) m = $(j + 1) } row++ }
+        END { printf "%.6g %.6g", s, m }' pt-out-index)
+    got=$(./rainfall_query index-out sum $1 $2 $3 $4 max $1 $2 $3 $4 | xargs printf "%.6g ")
+    if [ "$got" == "$want " ]; then
+        echo "index $rect ok"
+    else
+        echo "index $rect: $got, expected $want"
+    fi
+done
+rm -f index-out
+
+# the same at N = 4096 on a generated landscape, where the maxima
+# come from every level of the pyramid
+awk 'BEGIN { srand(7); N = 4096; for (i = 0; i < N; i++) { line = int(rand() * 100);
+     for (j = 1; j < N; j++) line = line " " int(rand() * 100); print line } }' >index-land-4096
+./rainfall_pt 1 1 0.5 4096 index-land-4096 --index=index-out 2>pt-out-index
+RECTS="0 0 4095 4095;1 1 4094 4094;0 5 0 4000;17 3 3000 3;100 200 2047 3333;4000 4001 4095 4095"
+awk -v rects="$RECTS" '
+    BEGIN { n = split(rects, rs, ";"); for (k = 1; k <= n; k++) { split(rs[k], v, " "); r0[k] = v[1]; c0[k] = v[2]; r1[k] = v[3]; c1[k] = v[4] } }
+    /^The following/ { row = 0; next }
+    row == "" { next }
+    { for (k = 1; k <= n; k++) if (row >= r0[k] && row <= r1[k]) for (j = c0[k]; j <= c1[k]; j++) { s[k] += $(j + 1); if (!(k in m) || $(j + 1) > m[k]) m[k] = $(j + 1) } row++ }
+    END { for (k = 1; k <= n; k++) printf "%.6g %.6g \n", s[k], m[k] }' pt-out-index >index-want
+IFS=";"
+k=1
+for rect in $RECTS; do
+    IFS=" "
+    set -- $rect
+    want=$(sed -n ${k}p index-want)
+    got=$(./rainfall_query index-out sum $1 $2 $3 $4 max $1 $2 $3 $4 | xargs printf "%.6g ")
+    if [ "$got" == "$want" ]; then
+        echo "index 4096 $rect ok"
+    else
+        echo "index 4096 $rect: $got, expected $want"
+    fi
+    k=$((k + 1))
+done
+unset IFS
+rm -f index-out index-want index-land-4096 pt-out-index
@@ -0,0 +1,45 @@
+#!/bin/bash
+# runs the 128x128 sample with each --output mode and compares the
+# reductions with ones taken from the reference grid
+cd rainfall
+N=128
+# rows, cols and blocks:B as "key value" lines from the reference grid
+reduce() {
+    awk -v mode=$1 -v B=$2 -v N=$N '
+        /^The following/ { row = 0; next }
+        row == "" || NF != N { next }
+        {
+            for (j = 1; j <= NF; j++) {
+                if (mode == "rows") s[row] += $j
+                else if (mode == "cols") s[j - 1] += $j
+                else { k = int(row / B) " " int((j - 1) / B); s[k] += $j; n[k]++ }
+            }
+            row++
+        }
+        END { for (k in s) print k, (mode == "blocks") ? s[k] / n[k] : s[k] }' $3
+}
+# the engine output in the same form
+engine() {
+    awk -v mode=$1 -v nb=$2 '
+        /^The following/ { on = 1; next }
+        !on { next }
+        mode == "blocks" { for (j = 1; j <= NF; j++) print row, j - 1, $j; row++; next }
+        { print row++, $1 }' $3
+}
+for mode in rows cols blocks:16 blocks:50; do
+    ./rainfall_pt 4 30 0.25 $N ../sample_128x128.in --output=$mode 2>output-out
+    name=${mode%%:*}
+    B=${mode#*:}
+    if join <(reduce $name $B ../sample_128x128.out | sed 's/ /_/' | sort) \
+            <(engine $name $B output-out | sed 's/ /_/' | sort) |
+        awk '{ d = $2 - $3; if (d < 0) d = -d; if (d > 1e-4 * ($2 < 0 ? -$2 : $2) + 1e-4) bad++; n++ }
+             END { exit bad > 0 || n == 0 }'; then
+        echo "output $mode ok"
+    else
+        echo "output $mode differs"
+    fi
+done
+./rainfall_pt 4 30 0.25 $N ../sample_128x128.in --output=hist:10 2>output-out
+total=$(awk '/^The following/ { on = 1; next } on { s += $NF; n++ } END { print n, s }' output-out)
+[ "$total" == "10 $((N * N))" ] && echo "output hist:10 ok" || echo "output hist:10 counts $total"
+rm -f output-out
@@ -0,0 +1,49 @@
+#!/bin/bash
+# runs the samples with --rain streams that rain one drop per cell for
+# M steps, dense, sparse and split over intervals, which have to match
+# the reference outputs
+cd rainfall
+# writes a stream for N x N of M steps: dense, sparse, or split, which
+# is half dense, an empty interval of no steps, a dry sparse one of no
+# steps and the rest sparse
+stream() {
+    python - $1 $2 $3 $4 <<'PY'
+import struct, sys
+N, M, kind, path = int(sys.argv[1]), int(sys.argv[2]), sys.argv[3], sys.argv[4]
+DENSE = 0xffffffff
+out = open(path, 'wb')
+out.write(b'RFRAIN\0\0' + struct.pack('II', 1, N))
+def dense(steps):
+    out.write(struct.pack('II', steps, DENSE) + struct.pack('f', 1.0) * (N * N))
+def sparse(steps, count):
+    out.write(struct.pack('II', steps, count))
+    for c in range(count):
+        out.write(struct.pack('If', c, 1.0))
+if kind == 'dense':
+    dense(M)
+elif kind == 'sparse':
+    sparse(M, N * N)
+else:
+    dense(M // 2)
+    dense(0)
+    sparse(0, 0)
+    sparse(M - M // 2, N * N)
+out.close()
+PY
+}
+# P M A N sample
+RUNS=("1 10 0.25 4 sample_4x4"
+      "2 20 0.5 16 sample_16x16"
+      "4 30 0.25 128 sample_128x128")
+for run in "${RUNS[@]}"; do
+    set -- $run
+    for kind in dense sparse split; do
+        stream $4 $2 $kind rain-in
+        # M is taken from the stream
+        ./rainfall_pt $1 0 $3 $4 ../$5.in --rain=rain-in 2>rain-out >/dev/null
+        echo -n "$5 $kind: "
+        ../check.py $4 ../$5.out rain-out
+        grep -q "took $(awk '/took/ { print $4 }' ../$5.out) time" rain-out || echo "step count differs"
+    done
+done
+rm -f rain-in rain-out
@@ -0,0 +1,22 @@
+#!/bin/bash
+# runs the samples with --retire, which has to print the same step
+# count and grid as the stepwise run, digit for digit
+cd rainfall
+# P M A N sample
+RUNS=("1 10 0.25 4 sample_4x4"
+      "2 20 0.5 16 sample_16x16"
+      "1 20 0.5 32 sample_32x32"
+      "4 30 0.25 128 sample_128x128"
+      "2 30 0.75 512 sample_512x512")
+for run in "${RUNS[@]}"; do
+    set -- $run
+    ./rainfall_pt $1 $2 $3 $4 ../$5.in 2>retire-ref >/dev/null
+    ./rainfall_pt $1 $2 $3 $4 ../$5.in --retire 2>retire-out >/dev/null
+    echo -n "$5: "
+    if cmp -s <(grep -v Runtime retire-ref) <(grep -v Runtime retire-out); then
+        echo "same as stepwise, $(awk '/Runtime/ { print $3 }' retire-ref) s -> $(awk '/Runtime/ { print $3 }' retire-out) s"
+    else
+        echo "differs from stepwise"
+    fi
+done
+rm -f retire-ref retire-out
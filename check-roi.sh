@@ -0,0 +1,24 @@
+#!/bin/bash
+# runs regions of the samples with --roi and compares them with the same
+# rows and columns of the full outputs
+cd rainfall
+# N M A r0 c0 r1 c1
+RUNS=("128 30 0.25 0 0 127 127"
+      "128 30 0.25 40 60 70 90"
+      "128 30 0.25 127 0 127 0"
+      "512 30 0.75 100 200 140 260")
+for run in "${RUNS[@]}"; do
+    set -- $run
+    ./rainfall_pt 2 $2 $3 $1 ../sample_$1x$1.in --roi=$4,$5,$6,$7 2>roi-out
+    if awk -v r0=$4 -v c0=$5 -v r1=$6 -v c1=$7 '
+        FNR == 1 { row = -1 }
+        /^The following/ { row = 0; next }
+        row < 0 { next }
+        FILENAME == ARGV[1] { if (row >= r0 && row <= r1) for (j = c0; j <= c1; j++) want[row, j] = $(j + 1); row++; next }
+        { for (j = c0; j <= c1; j++) if ($(j - c0 + 1) + 0 != want[row + r0, j] + 0) bad++; row++ }
+        END { exit bad > 0 || row != r1 - r0 + 1 }' ../sample_$1x$1.out roi-out; then
+        echo "roi $1 $4,$5,$6,$7 ok"
+    else
+        echo "roi $1 $4,$5,$6,$7 differs"
+    fi
+done
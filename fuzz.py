@@ -0,0 +1,200 @@
+#! /usr/bin/env python
+# Differential fuzzing of the engines against rainfall_seq.
+#
+# Generates random landscapes (random, tie heavy, plateau heavy and edge
+# heavy ones) with random M and A, runs rainfall_seq on each as the
+# oracle and every variant below on the same input, and reports
+# mismatches in the step count or any absorbed value (same tolerance as
+# check.py) along with each variant's speedup over rainfall_seq from the
+# reported runtimes. Failing inputs are kept as fuzz-fail-<case>.in.
+#
+# A variant can name per case values in braces: {A} for the absorption
+# rate, {roi} for a random region of the grid, {rain} for a --rain
+# stream of one drop per cell for M steps and {profile} for a scratch
+# autotune profile. --epsilon={A} may save the last step, and --roi is
+# compared with its region of the oracle and may take fewer steps.
+#
+# usage: ./fuzz.py [-n cases] [--seed S] [--max-n N] [variant ...]
+#        a variant is "P [options]", e.g. "4 --steal --chunk=1"
+
+from __future__ import print_function
+
+import argparse
+import os
+import random
+import struct
+import subprocess
+import sys
+
+VARIANTS = ['1', '3', '4 --steal', '4 --steal --chunk=1', '4 --tiles', '7 --tiles',
+            '2 --temporal=3', '2 --temporal=5 --tile=8', '1 --basins', '4 --basins',
+            '1 --retire', '4 --retire --tiles', '4 --backend=seq', '4 --backend=pool',
+            '4 --backend=openmp', '4 --backend=c11', '4 --steal --backend=pool', '4 --arena',
+            '2 --temporal=3 --arena', '4 --pin', '2 --epsilon={A} --epsilon-report',
+            '1 --roi={roi}', '2 --rain={rain}', '0 --profile={profile}']
+PATTERNS = ['random', 'ties', 'plateau', 'edge']
+# check.py's tolerance, plus a unit in the 6th digit the grids are
+# printed with: the threaded engines may add trickle in another order
+TOLERANCE = 0.0001
+DIGITS = 0.00001
+
+here = os.path.dirname(os.path.abspath(__file__))
+SEQ = os.path.join(here, 'rainfall', 'rainfall_seq')
+PT = os.path.join(here, 'rainfall', 'rainfall_pt')
+
+
+def landscape(rng, pattern, N):
+    if pattern == 'random':
+        return [[rng.randint(0, 1000) for j in range(N)] for i in range(N)]
+    if pattern == 'ties':
+        return [[rng.randint(0, 2) for j in range(N)] for i in range(N)]
+    if pattern == 'plateau':
+        # flat blocks at a few levels with the odd spike and pit
+        block = rng.randint(2, 8)
+        levels = {}
+        grid = []
+        for i in range(N):
+            row = []
+            for j in range(N):
+                key = (i // block, j // block)
+                if key not in levels:
+                    levels[key] = rng.choice([10, 20, 30])
+                v = levels[key]
+                if rng.random() < 0.02:
+                    v += rng.choice([-5, 5])
+                row.append(v)
+            grid.append(row)
+        return grid
+    # edge: lowest along the border so water runs off the sides, with
+    # ties between the border cells and their neighbours
+    return [[0 if min(i, j, N - 1 - i, N - 1 - j) == 0 else rng.randint(0, 3)
+             for j in range(N)] for i in range(N)]
+
+
+def rain_stream(path, N, M):
+    # dense for the first half of the steps and sparse for the rest, as
+    # two intervals, so both kinds and the switch between them are read
+    with open(path, 'wb') as out:
+        out.write(b'RFRAIN\0\0' + struct.pack('II', 1, N))
+        out.write(struct.pack('II', M // 2, 0xffffffff) + struct.pack('f', 1.0) * (N * N))
+        out.write(struct.pack('II', M - M // 2, N * N))
+        for c in range(N * N):
+            out.write(struct.pack('If', c, 1.0))
+
+
+def run(cmd):
+    proc = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    out, err = proc.communicate()
+    if proc.returncode != 0:
+        return None
+    steps, runtime, grid = None, None, []
+    for line in err.decode().splitlines():
+        parts = line.split()
+        if line.startswith('Rainfall simulation took'):
+            steps = int(parts[3])
+        elif line.startswith('Runtime'):
+            runtime = float(parts[2])
+        elif parts and (parts[0][0].isdigit() or parts[0][0] == '-'):
+            grid.append([float(v) for v in parts])
+    if steps is None:
+        return None
+    return steps, runtime, grid
+
+
+def region(want, roi):
+    r0, c0, r1, c1 = roi
+    return want[0], want[1], [row[c0:c1 + 1] for row in want[2][r0:r1 + 1]]
+
+
+def compare(want, got, fewest):
+    if got is None:
+        return 'failed to run'
+    if got[0] > want[0] or got[0] < fewest:
+        return 'took %d steps, expected %d' % (got[0], want[0])
+    if len(got[2]) != len(want[2]):
+        return 'grid has %d rows, expected %d' % (len(got[2]), len(want[2]))
+    for i, (a, b) in enumerate(zip(want[2], got[2])):
+        for j, (x, y) in enumerate(zip(a, b)):
+            if abs(x - y) > TOLERANCE + DIGITS * max(abs(x), abs(y)):
+                return 'mismatch at [%d][%d]: expected=%g, observed=%g' % (i, j, x, y)
+    return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Differential fuzzing against rainfall_seq')
+    parser.add_argument('-n', type=int, default=50, help='number of cases')
+    parser.add_argument('--seed', type=int, default=None)
+    parser.add_argument('--max-n', type=int, default=64, help='largest landscape')
+    parser.add_argument('variants', nargs='*', default=VARIANTS)
+    args = parser.parse_args()
+
+    seed = args.seed if args.seed is not None else random.randrange(1 << 30)
+    rng = random.Random(seed)
+    print('seed %d' % seed)
+    rain = 'fuzz-%d.rain' % os.getpid()
+    profile = 'fuzz-%d.profile' % os.getpid()
+    failures = 0
+    speedups = dict((v, []) for v in args.variants)
+    for case in range(args.n):
+        pattern = rng.choice(PATTERNS)
+        N = rng.randint(1, args.max_n)
+        M = rng.randint(0, 40)
+        A = rng.choice([0.25, 0.5, 0.75, 1, round(rng.uniform(0.05, 2), 2)])
+        path = 'fuzz-%d.in' % os.getpid()
+        with open(path, 'w') as f:
+            for row in landscape(rng, pattern, N):
+                f.write(' '.join(str(v) for v in row) + '\n')
+        r0, c0 = rng.randint(0, N - 1), rng.randint(0, N - 1)
+        roi = (r0, c0, rng.randint(r0, N - 1), rng.randint(c0, N - 1))
+        rain_stream(rain, N, M)
+        fields = {'A': A, 'roi': '%d,%d,%d,%d' % roi, 'rain': rain, 'profile': profile}
+
+        oracle = run([SEQ, '1', str(M), str(A), str(N), path])
+        if oracle is None:
+            print('case %d: rainfall_seq failed on %s N=%d' % (case, pattern, N))
+            failures += 1
+            os.rename(path, 'fuzz-fail-%d.in' % case)
+            continue
+        report = []
+        failed = False
+        for variant in args.variants:
+            words = variant.format(**fields).split()
+            got = run([PT, words[0], str(M), str(A), str(N), path] + words[1:])
+            if '{roi}' in variant:
+                error = compare(region(oracle, roi), got, 0)
+            elif '--epsilon' in variant:
+                error = compare(oracle, got, oracle[0] - 1)
+            else:
+                error = compare(oracle, got, oracle[0])
+            if error:
+                failed = True
+                report.append('  [%s] %s' % (variant, error))
+            elif got[1] > 0:
+                speedups[variant].append(oracle[1] / got[1])
+                report.append('  [%s] ok, %.2fx' % (variant, oracle[1] / got[1]))
+            else:
+                report.append('  [%s] ok' % variant)
+        print('case %d: %s N=%d M=%d A=%g, %d steps%s' %
+              (case, pattern, N, M, A, oracle[0], ', MISMATCH' if failed else ''))
+        if failed:
+            failures += 1
+            os.rename(path, 'fuzz-fail-%d.in' % case)
+            print('\n'.join(report))
+        else:
+            os.remove(path)
+            if case < 3 or N >= args.max_n // 2:
+                print('\n'.join(report))
+
+    for scratch in (rain, profile):
+        if os.path.exists(scratch):
+            os.remove(scratch)
+    print('%d of %d cases failed' % (failures, args.n))
+    for variant in args.variants:
+        s = sorted(speedups[variant])
+        if s:
+            print('  [%s] median speedup %.2fx' % (variant, s[len(s) // 2]))
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
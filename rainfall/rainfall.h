@@ -0,0 +1,84 @@
+#ifndef __RAINFALL_H
+#define __RAINFALL_H
+
+// librainfall - the rainfall simulation as a library
+//
+// A simulation is created from the contents of an elevation file (or
+// the file itself), stepped or run to completion, and its grids can be
+// read in place while it is alive:
+//
+//	rainfall_t *sim = rainfall_create(P, M, A, N, buf, len, 0, NULL);
+//	rainfall_run(sim);
+//	float *const *absorbed = rainfall_absorbed(sim); // absorbed[i][j]
+//	rainfall_destroy(sim);
+//
+// The grid storage types come from rainfall_storage.h and must match
+// the STORAGE the library was built with.
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "rainfall_storage.h"
+
+typedef struct simulation_struct rainfall_t;
+typedef struct landscape_struct rainfall_landscape_t;
+typedef struct rainfall_index_struct rainfall_index_t;
+
+// P threads, M rain steps, absorption rate A, N x N landscape
+// elevations/len: N lines of N space separated elevations
+// argc/argv: engine options as on the command line ("--steal", ...),
+// may be 0/NULL
+// returns NULL on bad arguments or a malformed landscape
+rainfall_t *rainfall_create(int P, int M, float A, int N,
+			    const char *elevations, size_t len,
+			    int argc, const char *argv[]);
+rainfall_t *rainfall_create_from_file(int P, int M, float A, int N,
+				      const char *elevation_file,
+				      int argc, const char *argv[]);
+void rainfall_destroy(rainfall_t *sim);
+
+// a parsed landscape with its flow directions, to run many simulations
+// on without parsing it again; it must outlive those simulations
+rainfall_landscape_t *rainfall_landscape_create(int N, const char *elevations, size_t len);
+rainfall_landscape_t *rainfall_landscape_load(int N, const char *elevation_file);
+void rainfall_landscape_destroy(rainfall_landscape_t *land);
+rainfall_t *rainfall_create_shared(int P, int M, float A,
+				   const rainfall_landscape_t *land,
+				   int argc, const char *argv[]);
+
+// advance by up to k steps, returns 1 once all rain is absorbed
+// (--temporal advances in whole blocks of at most k steps)
+int rainfall_step(rainfall_t *sim, int k);
+// run to completion, returns the number of steps it took
+int rainfall_run(rainfall_t *sim);
+
+int rainfall_num_steps(const rainfall_t *sim);
+double rainfall_runtime(const rainfall_t *sim); // seconds spent stepping
+int rainfall_size(const rainfall_t *sim); // N
+
+// the simulation's own grids, rows may not be contiguous with each other
+// valid until the next step or rainfall_destroy
+float *const *rainfall_absorbed(const rainfall_t *sim);
+water_t *const *rainfall_current_rain(const rainfall_t *sim);
+
+// the text report of rainfall_pt: step count, runtime and absorbed grid
+void rainfall_write_result(rainfall_t *sim, FILE *stream);
+
+// summed-area table and maxima of rain absorbed, as --index writes them
+// returns 0, or -1 if path can't be written
+int rainfall_write_index(rainfall_t *sim, const char *path);
+
+// a written index, mapped read only; the queries take an inclusive
+// rectangle of rows r0..r1 and columns c0..c1 and return -1 if it isn't
+// in the grid. Sums are O(1), maxima O(log^2 N) lookups in a pyramid
+// of aligned block maxima.
+rainfall_index_t *rainfall_index_open(const char *path);
+void rainfall_index_close(rainfall_index_t *index);
+int rainfall_index_size(const rainfall_index_t *index); // N
+int rainfall_index_steps(const rainfall_index_t *index); // of the run
+int rainfall_index_sum(const rainfall_index_t *index, int r0, int c0, int r1, int c1,
+		       double *sum);
+int rainfall_index_max(const rainfall_index_t *index, int r0, int c0, int r1, int c1,
+		       float *max);
+
+#endif
@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "rainfall_pt.h"
+
+// Runs a list of simulations as a pipeline: an input thread parses the
+// landscape of the next job while the current one runs and the main
+// thread writes out the previous one, so reading and writing overlap
+// with computing instead of adding to it as in run_all.sh. The stages
+// are connected by bounded queues, at most 2 * depth + 3 jobs are in
+// memory at once.
+//
+// A job is a line of the job file (- for stdin), blank lines and lines
+// starting with # are skipped:
+//
+//	<P> <M> <A> <N> <elevation_file> <output_file> [options]
+//
+// output_file gets the report of rainfall_pt, stdout gets a line per
+// job in job order and stderr the time each stage was busy.
+//
+// usage: rainfall_batch <job_file> [depth]
+#define MAX_DEPTH 64
+#define MAX_ARGS 64
+
+struct job_struct
+{
+	int id;
+	char *line; // the job's words point into it
+	int P, M, N;
+	float A;
+	const char *elevation_file, *output_file;
+	int argc;
+	const char *argv[MAX_ARGS];
+	rainfall_t *sim; // NULL if it couldn't be created
+	const char *error; // why the job failed, NULL if it didn't
+
+} typedef job;
+
+// bounded queue between two stages
+struct job_queue
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty, not_full;
+	job *jobs[MAX_DEPTH];
+	int head, count, depth;
+	int closed; // no more pushes
+
+} typedef job_queue;
+
+struct batch_struct
+{
+	FILE *jobs;
+	job_queue parsed, computed;
+	double input_busy, compute_busy; // seconds
+
+} typedef batch;
+
+static void queue_init(job_queue *q, int depth){
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+	q->head = q->count = q->closed = 0;
+	q->depth = depth;
+}
+
+static void queue_push(job_queue *q, job *j){
+	pthread_mutex_lock(&q->mutex);
+	while (q->count == q->depth){
+		pthread_cond_wait(&q->not_full, &q->mutex);
+	}
+	q->jobs[(q->head + q->count) % q->depth] = j;
+	q->count++;
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+// next job, NULL once the queue is closed and drained
+static job *queue_pop(job_queue *q){
+	pthread_mutex_lock(&q->mutex);
+	while (!q->count && !q->closed){
+		pthread_cond_wait(&q->not_empty, &q->mutex);
+	}
+	job *j = NULL;
+	if (q->count){
+		j = q->jobs[q->head];
+		q->head = (q->head + 1) % q->depth;
+		q->count--;
+		pthread_cond_signal(&q->not_full);
+	}
+	pthread_mutex_unlock(&q->mutex);
+	return j;
+}
+
+static void queue_close(job_queue *q){
+	pthread_mutex_lock(&q->mutex);
+	q->closed = 1;
+	pthread_cond_broadcast(&q->not_empty);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+static double seconds_since(struct timespec start){
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return calc_time(start, end) / 1000000000.0;
+}
+
+// split a job line into its fields, returns 0 for a line without a job
+static int parse_job(job *j){
+	const char *words[MAX_ARGS + 6];
+	int n = 0;
+	char *save;
+	for (char *word = strtok_r(j->line, " \t\n", &save); word;
+	     word = strtok_r(NULL, " \t\n", &save)){
+		if (n == MAX_ARGS + 6){
+			j->error = "too many options";
+			return 1;
+		}
+		words[n++] = word;
+	}
+	if (!n || (words[0][0] == '#')) return 0;
+	if (n < 6){
+		j->error = "needs P M A N elevation_file output_file";
+		return 1;
+	}
+	if (parse_num(words[0], &j->P) || parse_num(words[1], &j->M) ||
+	    parse_float(words[2], &j->A) || parse_num(words[3], &j->N)){
+		j->error = "P, M, A and N must be numbers";
+		return 1;
+	}
+	j->elevation_file = words[4];
+	j->output_file = words[5];
+	j->argc = n - 6;
+	memcpy(j->argv, words + 6, sizeof(char *) * j->argc);
+	return 1;
+}
+
+// input stage: read and parse the landscape of each job
+static void *input_stage(void *arg){
+	batch *b = arg;
+	char *line = NULL;
+	size_t size = 0;
+	int id = 0;
+	while (getline(&line, &size, b->jobs) >= 0){
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		job *j = calloc(1, sizeof(job));
+		j->line = strdup(line);
+		if (!parse_job(j)){
+			free(j->line);
+			free(j);
+			continue;
+		}
+		j->id = ++id;
+		if (!j->error){
+			j->sim = rainfall_create_from_file(j->P, j->M, j->A, j->N, j->elevation_file,
+							   j->argc, j->argv);
+			if (!j->sim) j->error = "landscape or options rejected";
+		}
+		b->input_busy += seconds_since(start);
+		queue_push(&b->parsed, j);
+	}
+	free(line);
+	queue_close(&b->parsed);
+	return NULL;
+}
+
+// compute stage: run each simulation to completion
+static void *compute_stage(void *arg){
+	batch *b = arg;
+	job *j;
+	while ((j = queue_pop(&b->parsed))){
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (j->sim) rainfall_run(j->sim);
+		b->compute_busy += seconds_since(start);
+		queue_push(&b->computed, j);
+	}
+	queue_close(&b->computed);
+	return NULL;
+}
+
+// output stage, on the calling thread: write each report, jobs arrive in order
+static double output_stage(batch *b, int *failed){
+	double busy = 0;
+	job *j;
+	while ((j = queue_pop(&b->computed))){
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		FILE *out = NULL;
+		if (!j->error && !(out = fopen(j->output_file, "w"))) j->error = "can't write output";
+		if (j->error){
+			printf("job %d: %s\n", j->id, j->error);
+			(*failed)++;
+		} else {
+			rainfall_write_result(j->sim, out);
+			fclose(out);
+			printf("job %d: %s %d steps %f s -> %s\n", j->id, j->elevation_file,
+			       rainfall_num_steps(j->sim), rainfall_runtime(j->sim), j->output_file);
+		}
+		fflush(stdout);
+		if (j->sim) rainfall_destroy(j->sim);
+		free(j->line);
+		free(j);
+		busy += seconds_since(start);
+	}
+	return busy;
+}
+
+int main(int argc, char const *argv[])
+{
+	if (argc < 2){
+		printf("Usage: %s <job_file> [depth]\n", argv[0]);
+		printf("* job_file = a job per line, - for stdin:"
+		       " <P> <M> <A> <N> <elevation_file> <output_file> [options]\n");
+		printf("* depth = jobs each queue between the input, compute and output"
+		       " stages holds (default 2, at most %d)\n", MAX_DEPTH);
+		return EXIT_SUCCESS;
+	}
+	int depth = (argc > 2) ? str_to_num(argv[2]) : 2;
+	if (depth < 1) depth = 1;
+	if (depth > MAX_DEPTH) depth = MAX_DEPTH;
+
+	batch b = {0};
+	b.jobs = strcmp(argv[1], "-") ? fopen(argv[1], "r") : stdin;
+	if (!b.jobs){
+		fprintf(stderr, "Error in opening file %s.\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	queue_init(&b.parsed, depth);
+	queue_init(&b.computed, depth);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_t input, compute;
+	pthread_create(&input, NULL, &input_stage, &b);
+	pthread_create(&compute, NULL, &compute_stage, &b);
+	int failed = 0;
+	double output_busy = output_stage(&b, &failed);
+	pthread_join(input, NULL);
+	pthread_join(compute, NULL);
+	if (b.jobs != stdin) fclose(b.jobs);
+
+	// run back to back the stages would have taken their sum
+	fprintf(stderr, "rainfall_batch: %f s, stages busy: input %f s, compute %f s,"
+		" output %f s\n", seconds_since(start), b.input_busy, b.compute_busy, output_busy);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
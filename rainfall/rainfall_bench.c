@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "rainfall_pt.h"
+
+// Kernel microbenchmark
+// Times each trickle kernel and the trickle update alone, single
+// threaded on warm grids that stay wet, at grid sizes that fit L1, L2
+// and the last level cache and one that doesn't. Parsing, all_absorbed,
+// thread start up and barriers are all left out. Each kernel is
+// reported in ns per cell and in GB/s of the grid traffic it has to
+// move, against the bandwidth of a STREAM triad over the same number of
+// bytes, so a kernel near 100% is bound by memory at that level.
+//
+// usage: rainfall_bench [N ...]   (default: one N per cache level)
+
+#define MIN_TIME 0.2 // seconds per measurement
+#define WET 1000 // starting water, the drain kernels take ~1 per call
+#define MAX_CALLS 500 // calls between rewetting
+#define DRAM_MAX (1L << 30) // bytes, the DRAM size is capped here
+
+// bytes of grid traffic per cell and call: flow read, current_rain,
+// rain_absorbed and trickle read and written once
+#define TRICKLE_BYTES (1 + 2 * sizeof(water_t) + 2 * sizeof(float) + 2 * sizeof(water_t))
+// current_rain read and written, trickle read
+#define UPDATE_BYTES (3 * sizeof(water_t))
+// flow, current_rain, trickle, rain_absorbed
+#define CELL_BYTES (1 + 2 * sizeof(water_t) + sizeof(float))
+
+static double now(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// best triad bandwidth over bytes of three double arrays, GB/s
+// a is only stored to, so each of its lines is read in before it is
+// written (write allocate): 32 bytes move per element, not 24, and they
+// are all counted, as the kernels' stores go to lines they just read
+static double stream_triad(size_t bytes){
+	size_t n = bytes / (3 * sizeof(double));
+	if (n < 64) n = 64;
+	double *a = malloc(sizeof(double) * n), *b = malloc(sizeof(double) * n);
+	double *c = malloc(sizeof(double) * n);
+	for (size_t i = 0; i < n; i++){
+		a[i] = 0;
+		b[i] = i;
+		c[i] = 2 * i;
+	}
+	double best = 0;
+	for (double start = now(); now() - start < MIN_TIME; ){
+		int reps = 1 + (int)(1e7 / n);
+		double t0 = now();
+		for (int r = 0; r < reps; r++){
+			for (size_t i = 0; i < n; i++) a[i] = b[i] + 3.0 * c[i];
+			__asm__ volatile("" : : "r"(a) : "memory");
+		}
+		double gbs = 4.0 * sizeof(double) * n * reps / (now() - t0) / 1e9;
+		if (gbs > best) best = gbs;
+	}
+	free(a);
+	free(b);
+	free(c);
+	return best;
+}
+
+// random landscape with plenty of ties, N lines of N elevations
+static char *make_landscape(int N, size_t *len){
+	char *buf = malloc((size_t)N * N * 4 + 1);
+	char *p = buf;
+	unsigned seed = 12345;
+	for (int i = 0; i < N; i++){
+		for (int j = 0; j < N; j++){
+			seed = seed * 1103515245 + 12345;
+			p += sprintf(p, "%u%c", (seed >> 16) % 64, (j == N - 1) ? '\n' : ' ');
+		}
+	}
+	*len = p - buf;
+	return buf;
+}
+
+static void wet(simulation *sim_data){
+	for (int i = 0; i < sim_data->N; i++){
+		for (int j = 0; j < sim_data->N; j++){
+			sim_data->current_rain[i][j] = WATER_STORE(WET);
+			sim_data->trickle[i][j] = 0;
+		}
+	}
+}
+
+// seconds per call of kernel on the whole grid, best of a few batches
+static double time_kernel(simulation *sim_data, trickle_kernel_t kernel){
+	int bounds[4] = {0, sim_data->N, 0, sim_data->N};
+	double cells = (double)sim_data->N * sim_data->N;
+	int calls = 1 + (int)(1e6 / cells);
+	if (calls > MAX_CALLS) calls = MAX_CALLS;
+	double best = -1;
+	wet(sim_data);
+	kernel ? kernel(bounds, sim_data) : update_trickle(sim_data); // warm up
+	for (double start = now(); now() - start < MIN_TIME; ){
+		wet(sim_data);
+		double t0 = now();
+		for (int c = 0; c < calls; c++){
+			if (kernel) kernel(bounds, sim_data);
+			else update_trickle(sim_data);
+		}
+		double t = (now() - t0) / calls;
+		if ((best < 0) || (t < best)) best = t;
+	}
+	return best;
+}
+
+static void bench(const char *level, int N){
+	size_t len;
+	char *buf = make_landscape(N, &len);
+	// P = 1 for the unlocked kernels, 2 for the ones taking row or tile locks
+	const char *tiles[] = {"--tiles"};
+	rainfall_t *sims[3] = {
+		rainfall_create(1, 1, 0.25, N, buf, len, 0, NULL),
+		rainfall_create(2, 1, 0.25, N, buf, len, 0, NULL),
+		rainfall_create(2, 1, 0.25, N, buf, len, 1, tiles),
+	};
+	free(buf);
+	const char *names[3] = {"", "_rows", "_tiles"};
+
+	double cells = (double)N * N;
+	double stream = stream_triad(cells * CELL_BYTES);
+	printf("%-5s N=%-6d %8.1f KB  STREAM triad %7.2f GB/s\n", level, N,
+	       cells * CELL_BYTES / 1024, stream);
+	for (int s = 0; s < 3; s++){
+		for (int rain = 1; rain >= 0; rain--){
+			char name[32];
+			snprintf(name, sizeof(name), "trickle_%s%s", rain ? "rain" : "drain", names[s]);
+			double t = time_kernel(sims[s], select_kernel(sims[s], rain));
+			double gbs = cells * TRICKLE_BYTES / t / 1e9;
+			printf("      %-20s %8.3f ns/cell %8.2f GB/s %6.1f%%\n",
+			       name, t / cells * 1e9, gbs, 100 * gbs / stream);
+		}
+	}
+	double t = time_kernel(sims[0], NULL);
+	double gbs = cells * UPDATE_BYTES / t / 1e9;
+	printf("      %-20s %8.3f ns/cell %8.2f GB/s %6.1f%%\n",
+	       "update_trickle", t / cells * 1e9, gbs, 100 * gbs / stream);
+	for (int s = 0; s < 3; s++){
+		rainfall_destroy(sims[s]);
+	}
+}
+
+// N whose grids take about bytes
+static int grid_size(long bytes){
+	int N = (int)sqrt((double)bytes / CELL_BYTES);
+	return (N < 8) ? 8 : N;
+}
+
+int main(int argc, char const *argv[])
+{
+	if (argc > 1){
+		for (int i = 1; i < argc; i++){
+			int N = str_to_num(argv[i]);
+			if (N < 2){
+				printf("Usage: %s [N ...]\n", argv[0]);
+				return EXIT_FAILURE;
+			}
+			bench("", N);
+		}
+		return EXIT_SUCCESS;
+	}
+
+	long l1 = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+	long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	if (l1 <= 0) l1 = 32 << 10;
+	if (l2 <= 0) l2 = 1 << 20;
+	if (llc <= 0) llc = 32 << 20;
+	long dram = (4 * llc < DRAM_MAX) ? 4 * llc : DRAM_MAX;
+	if (dram < 4 * l2) dram = 4 * l2;
+
+	// half of each cache, leaving room for the stack, locks and row pointers
+	bench("L1", grid_size(l1 / 2));
+	bench("L2", grid_size(l2 / 2));
+	bench("LLC", grid_size(llc / 2));
+	bench("DRAM", grid_size(dram));
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "rainfall_pt.h"
+#include "rainfall_proto.h"
+
+// Runs a simulation on rainfalld and prints the same report as
+// rainfall_pt. The path is sent absolute since the daemon has its own
+// working directory.
+//
+// usage: rainfall_client <P> <M> <A> <N> <elevation_file> [socket]
+int main(int argc, char const *argv[])
+{
+	if (argc < 6)
+	{
+		printf("Usage: %s <P> <M> <A> <N> <elevation_file> [socket]\n", argv[0]);
+		printf("Same as rainfall_pt, run on rainfalld listening on socket"
+		       " (default %s)\n", PROTO_SOCKET);
+		return EXIT_SUCCESS;
+	}
+	const char *sock_path = (argc > 6) ? argv[6] : PROTO_SOCKET;
+	char path[PATH_MAX];
+	if (!realpath(argv[5], path)){
+		fprintf(stderr, "Error in opening file %s.\n", argv[5]);
+		return EXIT_FAILURE;
+	}
+
+	struct proto_request req = {
+		.magic = PROTO_MAGIC,
+		.P = str_to_num(argv[1]),
+		.M = str_to_num(argv[2]),
+		.A = str_to_float(argv[3]),
+		.N = str_to_num(argv[4]),
+		.path_len = strlen(path),
+	};
+
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	strncpy(addr.sun_path, sock_path, sizeof(addr.sun_path) - 1);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ((fd < 0) || connect(fd, (struct sockaddr *)&addr, sizeof(addr))){
+		perror("rainfall_client: connect");
+		return EXIT_FAILURE;
+	}
+
+	struct proto_response resp;
+	if (proto_write(fd, &req, sizeof(req)) || proto_write(fd, path, req.path_len) ||
+	    proto_read(fd, &resp, sizeof(resp)) || (resp.magic != PROTO_MAGIC)){
+		fprintf(stderr, "rainfall_client: bad response from %s\n", sock_path);
+		return EXIT_FAILURE;
+	}
+	if (resp.status != PROTO_OK){
+		fprintf(stderr, "rainfall_client: %s\n", (resp.status == PROTO_BAD_LANDSCAPE) ?
+			"landscape could not be read" : "request rejected");
+		return EXIT_FAILURE;
+	}
+
+	int N = resp.N;
+	float **absorbed = malloc(sizeof(float *) * N);
+	for (int i = 0; i < N; i++){
+		absorbed[i] = malloc(sizeof(float) * N);
+		if (proto_read(fd, absorbed[i], sizeof(float) * N)){
+			fprintf(stderr, "rainfall_client: truncated response\n");
+			return EXIT_FAILURE;
+		}
+	}
+	close(fd);
+
+	fprintf(stderr, "Rainfall simulation took %d time steps to complete.\n", resp.num_steps);
+	fprintf(stderr, "Runtime = %f seconds.\n", resp.runtime);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "The following grid shows the number of raindrops absorbed at each point:\n");
+	print_data(stderr, N, absorbed);
+
+	for (int i = 0; i < N; i++){
+		free(absorbed[i]);
+	}
+	free(absorbed);
+	return EXIT_SUCCESS;
+}
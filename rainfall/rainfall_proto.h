@@ -0,0 +1,70 @@
+#ifndef __RAINFALL_PROTO_H
+#define __RAINFALL_PROTO_H
+
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Framing between rainfalld and its clients over a Unix domain socket.
+// One request per connection, all fields in host byte order since both
+// ends are on the same machine.
+//
+// request:  proto_request, then path_len bytes of elevation file path
+// response: proto_response, then N*N floats of rain absorbed in row
+//           major order if status is PROTO_OK
+
+#define PROTO_SOCKET "/tmp/rainfalld.sock" // default socket path
+#define PROTO_MAGIC 0x31464e52 // "RNF1"
+#define PROTO_MAX_PATH 4096
+
+#define PROTO_OK 0
+#define PROTO_BAD_REQUEST 1 // malformed request or bad P, M, A
+#define PROTO_BAD_LANDSCAPE 2 // file missing or not N x N
+
+struct proto_request
+{
+	uint32_t magic;
+	int32_t P; // threads for this job, P = 1 leaves the pool to spread jobs
+	int32_t M;
+	float A;
+	int32_t N;
+	uint32_t path_len; // without terminating 0
+};
+
+struct proto_response
+{
+	uint32_t magic;
+	int32_t status; // PROTO_*
+	int32_t num_steps;
+	int32_t N;
+	double runtime; // seconds spent simulating, queueing and loading not included
+};
+
+// read or write exactly len bytes, 0 on success
+static inline int proto_read(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	while (len){
+		ssize_t n = read(fd, p, len);
+		if ((n < 0) && (errno == EINTR)) continue;
+		if (n <= 0) return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static inline int proto_write(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	while (len){
+		ssize_t n = write(fd, p, len);
+		if ((n < 0) && (errno == EINTR)) continue;
+		if (n <= 0) return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+#endif
@@ -9,7 +9,186 @@
 
 #include <pthread.h>
 
+#include "rainfall_storage.h"
+
+// padded to a cache line so that neighbouring locks don't false share
+#define CACHE_LINE 64
+#define ROUND_UP(x, a) ((((x) + (a) - 1) / (a)) * (a))
+
+// a lock on a cache line of its own, so neighbouring locks in an array
+// never share a line (aligned like chunk_deque, not padded)
+struct row_lock_struct {
+	pthread_mutex_t mutex;
+} __attribute__((aligned(CACHE_LINE))) typedef row_lock_t;
+
+// deque of row chunks owned by one thread, see next_chunk
+struct chunk_deque_struct {
+	pthread_mutex_t mutex;
+	int head; // next chunk for the owner
+	int tail; // one past the last chunk, thieves take tail-1
+} __attribute__((aligned(CACHE_LINE))) typedef chunk_deque;
+
 // Structs
+// a parsed landscape and what is derived from it, read only once built
+// so any number of simulations can share it
+struct landscape_struct
+{
+	int N; // landscape size
+	elev_t **landscape; // elevations
+	uint8_t **flow; // FLOW_* mask of each cell, see compute_flow
+	void *map; // grids point into this mapping of a cache file, or NULL
+	size_t map_len;
+
+} typedef landscape;
+
+// neighbours a cell trickles to
+#define FLOW_NORTH 1 // i+1
+#define FLOW_SOUTH 2 // i-1
+#define FLOW_EAST 4 // j+1
+#define FLOW_WEST 8 // j-1
+
+// one mapping for the grids of a simulation (--arena)
+#define HUGE_PAGE (2 << 20)
+#define ARENA_REGULAR 0
+#define ARENA_THP 1
+#define ARENA_HUGETLB 2
+struct arena_struct
+{
+	char *map; // the mapping
+	size_t map_len;
+	char *base; // start in it, huge page aligned
+	size_t size, used;
+	int pages; // ARENA_*, what backs it
+	int open; // alloc_grid takes from it
+
+} typedef arena;
+
+// a block of whole lines of an inflated landscape, see read_landscape_gz
+struct gz_block_struct
+{
+	char *text;
+	size_t len;
+	int row; // of its first line
+
+} typedef gz_block;
+
+// blocks from the inflating thread to the parsers
+#define GZ_RING 8
+struct gz_ring_struct
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty, not_full;
+	gz_block *blocks[GZ_RING];
+	int head, count;
+	int done; // no more blocks coming
+	int error; // a parser hit a bad line
+	int N;
+	elev_t **landscape;
+
+} typedef gz_ring;
+
+// background writer of --snapshot, see take_snapshot
+struct snapshot_struct
+{
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond; // pending set or stop
+	FILE *out;
+	int text; // --snapshot-text
+	float *absorbed[2]; // N*N copies, one filled while the other is written
+	water_t *rain[2];
+	int step[2]; // num_steps of each copy
+	int pending; // buffer waiting for the writer, -1 if none
+	int writing; // buffer being written, -1 if none
+	int stop;
+	int written, skipped;
+
+} typedef snapshot;
+
+// reader of --rain, see next_rain_step
+struct rain_stream_struct
+{
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond; // a buffer filled or handed back, or stop
+	FILE *in;
+	int N;
+	float *rain[2]; // N*N, one falling while the other is read
+	int steps[2]; // steps of the interval in each buffer
+	int dry[2]; // no rain in the interval
+	int full[2]; // read and not yet handed back
+	int cur; // buffer falling now, -1 before the first
+	int left; // steps of it still to fall
+	int end; // the reader is past the last interval
+	int stop;
+	int started;
+	int bad_cells; // sparse cells outside the grid
+
+} typedef rain_stream;
+
+// --output modes
+#define OUTPUT_GRID 0
+#define OUTPUT_BLOCKS 1
+#define OUTPUT_ROWS 2
+#define OUTPUT_COLS 3
+#define OUTPUT_HIST 4
+
+// a cell of a basin for --basins
+struct cell_struct
+{
+	int i, j;
+
+} typedef cell_t;
+
+// a drainage basin, its cells are basin_cells[first .. first + count)
+struct basin_struct
+{
+	int first, count;
+	int steps; // steps this basin has been advanced
+	int wet; // a cell still had water after the last step, -1 if unknown
+	int done; // dry from M on, steps is its last step
+
+} typedef basin_t;
+
+// a cell of the --roi catchment, to are the compact indices it trickles to
+struct roi_cell_struct
+{
+	int i, j;
+	int count;
+	int to[4];
+
+} typedef roi_cell;
+
+// synchronisation policy of a trickle kernel, see select_kernel
+#define SYNC_NONE 0 // a single thread, nothing to lock
+#define SYNC_ROWS 1 // a lock per row
+#define SYNC_TILES 2 // a lock per tile for its outer ring (--tiles)
+
+// one step of trickle over the cells in bounds
+struct simulation_struct;
+typedef void (*trickle_kernel_t)(int *bounds, struct simulation_struct *sim_data);
+
+// how a step of the step kernels runs on the threads (--backend)
+struct backend_struct
+{
+	const char *name;
+	int (*run)(struct simulation_struct *sim_data); // every thread's share, -1 on failure
+
+} typedef backend;
+
+// persistent threads of --backend=pool, woken once per step
+struct worker_pool_struct
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t wake, done;
+	unsigned long step; // bumped to start a step
+	int busy; // threads still on the step
+	int stop;
+	pthread_t *threads;
+	int *ids;
+
+} typedef worker_pool;
+
 struct simulation_struct
 {
 	int P; // num_threads
@@ -17,11 +196,80 @@ struct simulation_struct
 	int num_steps; // total simulation steps
 	float A; // absorption
 	int N; // landscape size
-	int **landscape; // landscape array - input
-	float **current_rain; // keep track of rain through simulation
-	float **trickle; // keep track of trickle in each time-step
+	elev_t **landscape; // landscape array - input
+	uint8_t **flow; // where each cell trickles to, see compute_flow
+	const landscape *shared; // landscape and flow belong to the caller
+	int owns_shared; // unless they were loaded from the cache
+	water_t **current_rain; // keep track of rain through simulation
+	water_t **trickle; // keep track of trickle in each time-step
 	float **rain_absorbed; // rain absorbed in each tile output
-	const char *elevation_file; // name of input file
+	const char *elevation_file; // name of input file, NULL if from a buffer
+	int done; // all rain absorbed, num_steps is final
+	double runtime; // nanoseconds spent stepping
+	int pin; // pin threads to CPUs and first-touch bands (--pin)
+	int steal; // hand out rows in chunks with work stealing (--steal)
+	int chunk; // rows per chunk with --steal
+	int tiles; // 2D blocks instead of row bands (--tiles)
+	int temporal; // steps per temporal block (--temporal), 0 = off
+	int tile; // tile size for --temporal
+	const char *cache_dir; // --cache, NULL if off
+	int snapshot; // snapshot every k steps (--snapshot), 0 = off
+	const char *snapshot_file; // --snapshot-file
+	int snapshot_text; // --snapshot-text
+	snapshot *snap; // writer, started by the first snapshot
+	int autotune; // 1: P = 0, 2: --autotune
+	const char *profile; // --profile, NULL for the default
+	const backend *backend; // --backend
+	int retire; // --retire
+	uint8_t *live_in; // live cells flowing into each cell, RETIRED once retired
+	int *live_lo, *live_hi; // columns of each row that still have live cells
+	int retired_until; // step the last retired sink is dry at
+	float epsilon; // --epsilon, 0 = off
+	int epsilon_report; // --epsilon-report
+	float **epsilon_absorbed; // result at the epsilon stop while the exact run goes on
+	int epsilon_steps; // steps to the epsilon stop
+	int epsilon_saved; // steps the exact run took beyond it
+	double epsilon_left; // water absorbed where it stood at the stop
+	float epsilon_deviation; // largest difference to the exact result
+	worker_pool *pool; // started by the first step with --backend=pool
+
+	row_lock_t *row_locks; // locks for calc trickle, one per row
+	int *worker_cpus; // CPUs for --pin
+	int num_worker_cpus;
+	chunk_deque *deques; // one per thread for --steal
+	int tile_rows, tile_cols; // thread grid for --tiles
+	int *tile_of_row, *tile_of_col; // tile row/column of grid row/column, [N + j] in the last row
+	char *tile_edge_row, *tile_edge_col; // first or last row/column of a tile, as above
+	row_lock_t *tile_locks; // one per tile
+	water_t **next_rain; // current_rain after the block for --temporal
+	char *tile_dry; // [tile * k + step]: owned cells all dry at step start
+	int num_tiles_row; // temporal tiles per row and column of the grid
+	int block_steps; // steps in the current temporal block
+	int basins; // simulate drainage basins separately (--basins)
+	basin_t *basin_list; // basin 0 groups the large basins, the rest largest first
+	int num_basins;
+	cell_t *basin_cells; // cells of every basin, row major within each
+	int next_basin; // next basin for a thread to take
+	int *basin_wet; // per thread, its part of basin 0 still wet
+	pthread_barrier_t basin_barrier; // steps of basin 0
+	int roi; // only simulate the catchment of a region (--roi)
+	int roi_r0, roi_c0, roi_r1, roi_c1; // the region, inclusive
+	roi_cell *roi_cells; // the catchment in row order
+	int roi_count;
+	water_t *roi_rain, *roi_trickle; // current rain and trickle, then the sink
+	float *roi_absorbed;
+	const char *index_path; // --index, NULL if off
+	int use_arena; // --arena
+	arena *arena; // grids and their row pointers if use_arena
+	int tlb_report; // --tlb-report
+	int tlb_fd; // dTLB miss counter, -1 if perf events aren't allowed
+	long faults; // page faults before setup_grids
+	int output; // OUTPUT_*, --output
+	int output_arg; // block size or bins
+	const char *rain_file; // --rain, NULL for a drop per cell for M steps
+	rain_stream *rain;
+	const float *step_rain; // rain of this step for the field kernels, NULL if none
+	trickle_kernel_t kernel; // trickle kernel of this step, see select_kernel
 
 } typedef simulation;
 
@@ -29,28 +277,105 @@ struct calc_trickle_args_t {
          simulation *sim_data;
          int *thread_id;
          int rain_drop;
+         int target; // last step for thread_basins
 }typedef calc_trickle_args;
 
+#include "rainfall.h"
 
 // Functions
 // General Purpose Functions
 double calc_time(struct timespec start, struct timespec end);
 void print_data(FILE* stream, int N, float **data_struct);
 void usage(const char *prog_name);
+int parse_options(simulation *sim_data, int argc, char const *argv[]);
 size_t str_to_num(const char *str);
 float str_to_float(const char *str);
-int get_nums(int size, const char *line, int *landscape_row);
+int parse_num(const char *str, int *val);
+int parse_float(const char *str, float *val);
+int get_nums(int size, const char **pos, const char *end, elev_t *landscape_row);
+
+// Threads and memory placement
+void init_worker_cpus(simulation *sim_data);
+int create_worker(simulation *sim_data, pthread_t *thread, int thread_id,
+		  void *(*start_routine)(void *), void *args);
+void **alloc_grid(simulation *sim_data, size_t elem_size);
+void free_grid(void **rows);
+void *thread_first_touch(void *arguments);
+void first_touch_grids(simulation *sim_data);
+void init_deques(simulation *sim_data);
+void free_deques(simulation *sim_data);
+void fill_deques(simulation *sim_data);
+int next_chunk(simulation *sim_data, int thread_id);
+void work_trickle(simulation *sim_data, int thread_id);
+const backend *find_backend(const char *name);
+void stop_pool(simulation *sim_data);
 
 // Special purpose Functions
-void read_landscape(simulation *sim_data);
+int read_landscape(int N, elev_t **landscape, const char *buf, size_t len);
+void compute_flow(int N, elev_t **landscape, uint8_t **flow);
+const char *map_file(const char *path, size_t *len);
+
+// drainage basins
+void init_basins(simulation *sim_data);
+void free_basins(simulation *sim_data);
+void *thread_basins(void *arguments);
+int basins_steps(simulation *sim_data, int num);
+
+// region of interest
+void init_roi(simulation *sim_data);
+void free_roi(simulation *sim_data);
+int roi_steps(simulation *sim_data, int num);
+
+// grid arena
+int init_arena(simulation *sim_data, int shared);
+void *arena_alloc(arena *a, size_t size, size_t align);
+void free_arena(simulation *sim_data);
+void start_tlb_report(simulation *sim_data);
+void write_tlb_report(simulation *sim_data, FILE *stream);
+
+// rain stream
+int open_rain(simulation *sim_data);
+void *rain_reader(void *arg);
+float *next_rain_step(simulation *sim_data);
+void close_rain(simulation *sim_data);
+
+// reduced output
+void *thread_reduce(void *arguments);
+void write_reduced(simulation *sim_data, FILE *stream);
+
+// result index
+int write_index(simulation *sim_data, const char *path);
+
+// snapshots
+void *snapshot_writer(void *arg);
+int start_snapshots(simulation *sim_data);
+void take_snapshot(simulation *sim_data);
+void stop_snapshots(simulation *sim_data);
+
+// landscape cache
+uint64_t landscape_hash(const char *buf, size_t len);
+landscape *cache_load(const char *dir, int N, uint64_t hash);
+void cache_store(const char *dir, int N, uint64_t hash, elev_t **elev, uint8_t **flow);
 int parallel_calculate_trickle(simulation *sim_data, int rain_drop);
 void *thread_calc_trickle(void *arguments);
-int calculate_trickle(int * bounds, simulation *sim_data, int rain_drop);
+trickle_kernel_t select_kernel(simulation *sim_data, int rain_drop);
 void update_trickle(simulation *sim_data);
 void get_bounds(simulation *sim_data, int thread_id, int *bounds);
+void init_tiles(simulation *sim_data);
+void free_tiles(simulation *sim_data);
+void get_tile_bounds(simulation *sim_data, int thread_id, int *bounds);
 int all_absorbed(simulation *sim_data);
+void write_epsilon_report(simulation *sim_data, FILE *stream);
+void init_retire(simulation *sim_data);
+void free_retire(simulation *sim_data);
+int retire_cells(simulation *sim_data);
+void temporal_step(simulation *sim_data, water_t *cur, water_t *trk, int w, int h,
+		   int lr0, int lc0, int *valid, int *owned, int rain_drop);
+void *thread_temporal(void *arguments);
+int temporal_block(simulation *sim_data, int k);
+int simulate_steps(simulation *sim_data, int num);
 void run_simulation(simulation * sim_data);
-void write_result(simulation *sim_data);
+void write_result(simulation *sim_data, FILE *stream);
 
 
 #endif
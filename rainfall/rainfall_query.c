@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rainfall.h"
+
+// Answers rectangle queries on an index written with --index, one per
+// line of stdin or per group of arguments:
+//
+//	sum <r0> <c0> <r1> <c1>   total absorbed in rows r0..r1, columns c0..c1
+//	max <r0> <c0> <r1> <c1>   largest absorbed in the same
+//
+// usage: rainfall_query <index_file> [query ...]
+
+static int query(const rainfall_index_t *index, const char *op, int r0, int c0, int r1, int c1){
+	if (!strcmp(op, "sum")){
+		double sum;
+		if (rainfall_index_sum(index, r0, c0, r1, c1, &sum)) return -1;
+		printf("%.17g\n", sum);
+	} else if (!strcmp(op, "max")){
+		float max;
+		if (rainfall_index_max(index, r0, c0, r1, c1, &max)) return -1;
+		printf("%.9g\n", max);
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char const *argv[])
+{
+	if (argc < 2)
+	{
+		printf("Usage: %s <index_file> [sum|max <r0> <c0> <r1> <c1>] ...\n", argv[0]);
+		printf("Totals and maxima of rain absorbed over rows r0..r1 and columns"
+		       " c0..c1, from an index written with --index. Queries are read"
+		       " from stdin, one per line, unless given as arguments.\n");
+		return EXIT_SUCCESS;
+	}
+	rainfall_index_t *index = rainfall_index_open(argv[1]);
+	if (!index) return EXIT_FAILURE;
+
+	int status = EXIT_SUCCESS;
+	if (argc > 2){
+		for (int i = 2; i < argc; i += 5){
+			if ((i + 4 >= argc) || query(index, argv[i], atoi(argv[i+1]), atoi(argv[i+2]),
+						     atoi(argv[i+3]), atoi(argv[i+4]))){
+				fprintf(stderr, "bad query: %s\n", argv[i]);
+				status = EXIT_FAILURE;
+				break;
+			}
+		}
+	} else {
+		char line[256], op[8];
+		int r0, c0, r1, c1;
+		while (fgets(line, sizeof(line), stdin)){
+			if ((sscanf(line, "%7s %d %d %d %d", op, &r0, &c0, &r1, &c1) != 5) ||
+			    query(index, op, r0, c0, r1, c1)){
+				fprintf(stderr, "bad query: %s", line);
+				status = EXIT_FAILURE;
+			}
+		}
+	}
+	rainfall_index_close(index);
+	return status;
+}
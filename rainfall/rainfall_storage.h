@@ -0,0 +1,69 @@
+#ifndef __RS_H
+#define __RS_H
+
+#include <stdint.h>
+
+// Storage types for the simulation grids, selected at compile time
+// e.g. make STORAGE="-DELEV_BITS=8 -DWATER_HALF"
+//
+// ELEV_BITS = 8 | 16 | 32 (default) - bits per landscape cell
+// WATER_HALF                        - current_rain/trickle as _Float16
+// WATER_FIXED                       - current_rain/trickle as Q fixed point
+//                                     with WATER_FRAC_BITS fraction bits
+// rain_absorbed is the output and always stays float.
+// All arithmetic in the kernel is still done in float, only the
+// stored representation changes. ../storage_report.sh compares every
+// mode against the float baseline.
+
+#ifndef ELEV_BITS
+#define ELEV_BITS 32
+#endif
+
+#if ELEV_BITS == 8
+typedef uint8_t elev_t;
+#define ELEV_MAX UINT8_MAX
+#elif ELEV_BITS == 16
+typedef uint16_t elev_t;
+#define ELEV_MAX UINT16_MAX
+#elif ELEV_BITS == 32
+typedef int elev_t;
+#define ELEV_MAX INT32_MAX
+#else
+#error "ELEV_BITS must be 8, 16 or 32"
+#endif
+
+#if defined(WATER_HALF) && defined(WATER_FIXED)
+#error "WATER_HALF and WATER_FIXED are mutually exclusive"
+#endif
+
+#if defined(WATER_HALF)
+// half precision: 11 bit mantissa, exact for multiples of 1/1024 below 2
+// add -mf16c to STORAGE on x86 or every load/store is a library call
+typedef _Float16 water_t;
+#define WATER_LOAD(w) ((float)(w))
+#define WATER_STORE(x) ((water_t)(x))
+#define WATER_ADD(w, x) ((w) += (x))
+
+#elif defined(WATER_FIXED)
+// fixed point: exact and order independent for multiples of 2^-FRAC_BITS,
+// A = 0.25, 0.5, 0.75 and whole drops never round
+#ifndef WATER_FRAC_BITS
+#define WATER_FRAC_BITS 16
+#endif
+typedef int32_t water_t;
+#define WATER_ONE ((float)(1 << WATER_FRAC_BITS))
+#define WATER_LOAD(w) ((float)(w) / WATER_ONE)
+#define WATER_STORE(x) ((water_t)((x) * WATER_ONE + 0.5f)) // water is never negative
+#define WATER_ADD(w, x) ((w) += WATER_STORE(x))
+
+#else
+typedef float water_t;
+#define WATER_LOAD(w) (w)
+#define WATER_STORE(x) (x)
+#define WATER_ADD(w, x) ((w) += (x))
+#endif
+
+// value as it will read back after being stored
+#define WATER_ROUND(x) WATER_LOAD(WATER_STORE(x))
+
+#endif
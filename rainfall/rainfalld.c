@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "rainfall_pt.h"
+#include "rainfall_proto.h"
+
+// Simulation daemon
+// Keeps parsed landscapes (elevations and flow directions) in an LRU
+// cache keyed by path and mtime, and runs the jobs of rainfall_client
+// on a pool of W worker threads, see rainfall_proto.h for the framing.
+//
+// usage: rainfalld <W> <cache_entries> [socket]
+
+// Landscape cache
+// an entry stays in use while a job holds it, eviction only picks idle
+// entries, so the cache can go over capacity while every entry is busy.
+// An entry replaced or evicted while in use is freed by its last job.
+struct cache_entry
+{
+	char *path;
+	int N;
+	struct timespec mtime;
+	off_t size;
+	rainfall_landscape_t *land;
+	int refs; // jobs using it
+	int linked; // still in the cache
+	unsigned long last_used;
+	struct cache_entry *next;
+
+} typedef cache_entry;
+
+struct cache
+{
+	pthread_mutex_t mutex;
+	cache_entry *head;
+	int count, capacity;
+	unsigned long clock; // bumped on every lookup for LRU
+	unsigned long hits, misses;
+
+} typedef cache;
+
+// Connection queue
+// accepted sockets waiting for a worker, bounded so a burst of clients
+// waits in the listen backlog instead of piling up here
+#define QUEUE_SIZE 64
+
+struct conn_queue
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty, not_full;
+	int fds[QUEUE_SIZE];
+	int head, count;
+	int closed;
+
+} typedef conn_queue;
+
+struct daemon_struct
+{
+	cache cache;
+	conn_queue queue;
+
+} typedef daemon_t;
+
+static volatile sig_atomic_t stop;
+
+static void handle_stop(int sig){
+	(void)sig;
+	stop = 1;
+}
+
+static void unlink_entry(cache *c, cache_entry *e){
+	for (cache_entry **p = &c->head; *p; p = &(*p)->next){
+		if (*p == e){
+			*p = e->next;
+			break;
+		}
+	}
+	e->linked = 0;
+	c->count--;
+}
+
+static void free_entry(cache_entry *e){
+	rainfall_landscape_destroy(e->land);
+	free(e->path);
+	free(e);
+}
+
+// drop idle least recently used entries until back under capacity
+static void evict(cache *c){
+	while (c->count > c->capacity){
+		cache_entry *lru = NULL;
+		for (cache_entry *e = c->head; e; e = e->next){
+			if (!e->refs && (!lru || (e->last_used < lru->last_used))){
+				lru = e;
+			}
+		}
+		if (!lru) return;
+		unlink_entry(c, lru);
+		free_entry(lru);
+	}
+}
+
+static int same_version(cache_entry *e, struct stat *st){
+	return (e->mtime.tv_sec == st->st_mtim.tv_sec) &&
+	       (e->mtime.tv_nsec == st->st_mtim.tv_nsec) &&
+	       (e->size == st->st_size);
+}
+
+// whether a file of size bytes can hold N lines of N elevations, each
+// at least a digit and a separator; gzip inflates at most 1032 times
+// (deflate's limit), so a client's N can't make us allocate grids far
+// larger than the file before parsing finds out
+static int can_hold(const char *path, off_t size, int N){
+	unsigned char magic[2] = {0, 0};
+	FILE *f = fopen(path, "rb");
+	if (!f) return 0;
+	size_t got = fread(magic, 1, sizeof(magic), f);
+	fclose(f);
+	double bytes = (double)size;
+	if ((got == 2) && (magic[0] == 0x1f) && (magic[1] == 0x8b)) bytes *= 1032;
+	return 2.0 * N * N - 1 <= bytes; // the last one may not end the line
+}
+
+// landscape of path for N, loaded if not cached or changed on disk
+// returns NULL if it can't be read, cache_release when done with it
+cache_entry *cache_acquire(cache *c, const char *path, int N){
+	struct stat st;
+	if (stat(path, &st)) return NULL;
+	if (!can_hold(path, st.st_size, N)) return NULL;
+
+	pthread_mutex_lock(&c->mutex);
+	for (cache_entry *e = c->head; e; e = e->next){
+		if ((e->N != N) || strcmp(e->path, path)) continue;
+		if (same_version(e, &st)){
+			e->refs++;
+			e->last_used = ++c->clock;
+			c->hits++;
+			pthread_mutex_unlock(&c->mutex);
+			return e;
+		}
+		// file changed, jobs still running on the old one keep it
+		unlink_entry(c, e);
+		if (!e->refs) free_entry(e);
+		break;
+	}
+	c->misses++;
+	pthread_mutex_unlock(&c->mutex);
+
+	// parse without holding the cache, other jobs keep going
+	rainfall_landscape_t *land = rainfall_landscape_load(N, path);
+	if (!land) return NULL;
+	cache_entry *new = calloc(1, sizeof(cache_entry));
+	new->path = strdup(path);
+	new->N = N;
+	new->mtime = st.st_mtim;
+	new->size = st.st_size;
+	new->land = land;
+	new->refs = 1;
+	new->linked = 1;
+
+	pthread_mutex_lock(&c->mutex);
+	// another job may have loaded the same version meanwhile, keep one
+	for (cache_entry *e = c->head; e; e = e->next){
+		if ((e->N == N) && !strcmp(e->path, path) && same_version(e, &st)){
+			e->refs++;
+			e->last_used = ++c->clock;
+			pthread_mutex_unlock(&c->mutex);
+			free_entry(new);
+			return e;
+		}
+	}
+	new->last_used = ++c->clock;
+	new->next = c->head;
+	c->head = new;
+	c->count++;
+	evict(c);
+	pthread_mutex_unlock(&c->mutex);
+	return new;
+}
+
+void cache_release(cache *c, cache_entry *e){
+	pthread_mutex_lock(&c->mutex);
+	e->refs--;
+	if (!e->refs){
+		if (!e->linked) free_entry(e);
+		else evict(c);
+	}
+	pthread_mutex_unlock(&c->mutex);
+}
+
+void queue_push(conn_queue *q, int fd){
+	pthread_mutex_lock(&q->mutex);
+	while (q->count == QUEUE_SIZE){
+		pthread_cond_wait(&q->not_full, &q->mutex);
+	}
+	q->fds[(q->head + q->count) % QUEUE_SIZE] = fd;
+	q->count++;
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+// next connection, -1 once the queue is closed and drained
+int queue_pop(conn_queue *q){
+	pthread_mutex_lock(&q->mutex);
+	while (!q->count && !q->closed){
+		pthread_cond_wait(&q->not_empty, &q->mutex);
+	}
+	int fd = -1;
+	if (q->count){
+		fd = q->fds[q->head];
+		q->head = (q->head + 1) % QUEUE_SIZE;
+		q->count--;
+		pthread_cond_signal(&q->not_full);
+	}
+	pthread_mutex_unlock(&q->mutex);
+	return fd;
+}
+
+static int send_status(int fd, int status){
+	struct proto_response resp = {.magic = PROTO_MAGIC, .status = status};
+	return proto_write(fd, &resp, sizeof(resp));
+}
+
+// run one request on a connection
+void serve(daemon_t *d, int fd){
+	struct proto_request req;
+	char path[PROTO_MAX_PATH + 1];
+
+	if (proto_read(fd, &req, sizeof(req))) return;
+	if ((req.magic != PROTO_MAGIC) || (req.path_len > PROTO_MAX_PATH) ||
+	    (req.P < 1) || (req.M < 0) || (req.A < 0) || (req.N < 1)){
+		send_status(fd, PROTO_BAD_REQUEST);
+		return;
+	}
+	if (proto_read(fd, path, req.path_len)) return;
+	path[req.path_len] = 0;
+
+	cache_entry *e = cache_acquire(&d->cache, path, req.N);
+	if (!e){
+		send_status(fd, PROTO_BAD_LANDSCAPE);
+		return;
+	}
+	rainfall_t *sim = rainfall_create_shared(req.P, req.M, req.A, e->land, 0, NULL);
+	if (!sim){
+		cache_release(&d->cache, e);
+		send_status(fd, PROTO_BAD_REQUEST);
+		return;
+	}
+	rainfall_run(sim);
+
+	struct proto_response resp = {
+		.magic = PROTO_MAGIC,
+		.status = PROTO_OK,
+		.num_steps = rainfall_num_steps(sim),
+		.N = req.N,
+		.runtime = rainfall_runtime(sim),
+	};
+	float *const *absorbed = rainfall_absorbed(sim);
+	if (!proto_write(fd, &resp, sizeof(resp))){
+		for (int i = 0; i < req.N; i++){
+			if (proto_write(fd, absorbed[i], sizeof(float) * req.N)) break;
+		}
+	}
+	rainfall_destroy(sim);
+	cache_release(&d->cache, e);
+}
+
+void *worker(void *arg){
+	daemon_t *d = arg;
+	int fd;
+	while ((fd = queue_pop(&d->queue)) >= 0){
+		serve(d, fd);
+		close(fd);
+	}
+	return NULL;
+}
+
+int main(int argc, char const *argv[])
+{
+	if (argc < 3){
+		printf("Usage: %s <W> <cache_entries> [socket]\n", argv[0]);
+		printf("* W = # of jobs run at the same time\n");
+		printf("* cache_entries = # of parsed landscapes kept in memory\n");
+		printf("* socket = path of the Unix socket (default %s)\n", PROTO_SOCKET);
+		return EXIT_SUCCESS;
+	}
+	int W = str_to_num(argv[1]);
+	int capacity = str_to_num(argv[2]);
+	const char *sock_path = (argc > 3) ? argv[3] : PROTO_SOCKET;
+	if (W < 1) W = 1;
+
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if (strlen(sock_path) >= sizeof(addr.sun_path)){
+		fprintf(stderr, "socket path too long: %s\n", sock_path);
+		return EXIT_FAILURE;
+	}
+	strcpy(addr.sun_path, sock_path);
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(sock_path);
+	if ((listen_fd < 0) || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(listen_fd, SOMAXCONN)){
+		perror("rainfalld: socket");
+		return EXIT_FAILURE;
+	}
+
+	// no SA_RESTART, accept has to return on a signal
+	struct sigaction sa = {.sa_handler = handle_stop};
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN); // clients that go away are just errors on write
+
+	daemon_t d = {0};
+	pthread_mutex_init(&d.cache.mutex, NULL);
+	d.cache.capacity = capacity;
+	pthread_mutex_init(&d.queue.mutex, NULL);
+	pthread_cond_init(&d.queue.not_empty, NULL);
+	pthread_cond_init(&d.queue.not_full, NULL);
+
+	pthread_t *workers = malloc(sizeof(pthread_t) * W);
+	for (int i = 0; i < W; i++){
+		pthread_create(&workers[i], NULL, worker, &d);
+	}
+
+	fprintf(stderr, "rainfalld: %d workers, %d cached landscapes, listening on %s\n",
+		W, capacity, sock_path);
+	while (!stop){
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0){
+			if (errno == EINTR) continue;
+			perror("rainfalld: accept");
+			break;
+		}
+		queue_push(&d.queue, fd);
+	}
+
+	// let the workers finish what has been accepted
+	pthread_mutex_lock(&d.queue.mutex);
+	d.queue.closed = 1;
+	pthread_cond_broadcast(&d.queue.not_empty);
+	pthread_mutex_unlock(&d.queue.mutex);
+	for (int i = 0; i < W; i++){
+		pthread_join(workers[i], NULL);
+	}
+	close(listen_fd);
+	unlink(sock_path);
+
+	fprintf(stderr, "rainfalld: %lu cache hits, %lu misses\n", d.cache.hits, d.cache.misses);
+	while (d.cache.head){
+		cache_entry *e = d.cache.head;
+		d.cache.head = e->next;
+		free_entry(e);
+	}
+	free(workers);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,62 @@
+#!/bin/bash
+# Accuracy report of the reduced precision storage modes (rainfall_storage.h)
+# against the float baseline on the sample inputs.
+# usage: ./storage_report.sh [P]
+P=${1:-1}
+MODES=("float:"
+       "e16:-DELEV_BITS=16"
+       "e8:-DELEV_BITS=8"
+       "e8_fixed:-DELEV_BITS=8 -DWATER_FIXED"
+       "e16_half:-DELEV_BITS=16 -DWATER_HALF -mf16c"
+       "e8_half:-DELEV_BITS=8 -DWATER_HALF -mf16c")
+# P M A N file
+RUNS=("10 0.25 4 sample_4x4"
+      "20 0.5 16 sample_16x16"
+      "20 0.5 32 sample_32x32"
+      "30 0.25 128 sample_128x128"
+      "30 0.75 512 sample_512x512")
+
+cd rainfall
+for mode in "${MODES[@]}"; do
+    name=${mode%%:*}
+    make -s -B rainfall_pt STORAGE="${mode#*:}" || exit 1
+    mv rainfall_pt rainfall_pt_$name
+done
+make -s -B rainfall_pt
+
+# max and mean absolute difference of the result grids, then the step counts
+compare() {
+    awk -v N=$1 '
+        /took/ { steps[FILENAME] = $4 }
+        NF == N && $1 ~ /^[-0-9.]/ { v = FILENAME == ARGV[1] ? "a" : "b"; n[v]++; grid[v, n[v]] = $0 }
+        END {
+            max = 0; sum = 0
+            for (r = 1; r <= N; r++) {
+                split(grid["a", r], a); split(grid["b", r], b)
+                for (c = 1; c <= N; c++) {
+                    d = a[c] - b[c]; if (d < 0) d = -d
+                    sum += d; if (d > max) max = d
+                }
+            }
+            printf "%12.6g %12.6g %8d %8d\n", max, sum / (N * N), steps[ARGV[1]], steps[ARGV[2]]
+        }' $2 $3
+}
+
+printf "%-10s %-16s %12s %12s %8s %8s %10s\n" mode input max_abs mean_abs steps_f steps rt_s
+for run in "${RUNS[@]}"; do
+    set -- $run
+    [ -f ../$4.in ] || continue
+    ./rainfall_pt_float $P $1 $2 $3 ../$4.in 2> out-float
+    for mode in "${MODES[@]}"; do
+        name=${mode%%:*}
+        ./rainfall_pt_$name $P $1 $2 $3 ../$4.in 2> out-$name || continue
+        rt=$(awk '/Runtime/ { print $3 }' out-$name)
+        # the float baseline itself is checked against the reference output
+        ref=out-float; [ $name = float ] && ref=../$4.out
+        printf "%-10s %-16s %s %10s\n" $name $4 "$(compare $3 $ref out-$name)" $rt
+    done
+done
+
+for mode in "${MODES[@]}"; do
+    rm -f rainfall_pt_${mode%%:*} out-${mode%%:*}
+done